@@ -1,47 +1,200 @@
 #include "Logger2.h"
 
+#include <stdarg.h>
+#ifdef _WIN32
+#include <process.h>
+#endif
+
 // Initialize the file path variable globally to avoid repetition in each function
 // const char *filePath2 = "C:\\ProgramData\\mws_lib.log";
+#ifdef _WIN32
 const char *filePath2 = "C:\\ProgramData\\softTokenReaderDriver.log";
+#else
+const char *filePath2 = "/tmp/softTokenReaderDriver.log";
+#endif
+
+// ---- Lock-free ring buffer --------------------------------------------------
+// Producers (any thread on the data path) claim a slot with an interlocked
+// compare-exchange, format their message into it, then publish it with the
+// slot's 'ready' flag. A single background thread drains ready slots to the
+// log file, so the hot path never opens or writes a file. When the ring is
+// full, messages are dropped and counted rather than blocking the producer.
+
+#define MWS_LOG_RING_SLOTS 1024 // Must be a power of two
+#define MWS_LOG_SLOT_SIZE 256
+
+typedef struct
+{
+    volatile LONG ready; // Nonzero once text[] is fully written
+    char text[MWS_LOG_SLOT_SIZE];
+} mws_log_slot;
+
+static mws_log_slot log_ring[MWS_LOG_RING_SLOTS];
+static volatile LONG log_head = 0;    // Next sequence number to claim (producers)
+static volatile LONG log_tail = 0;    // Next sequence number to drain (writer only)
+static volatile LONG log_dropped = 0; // Messages lost to a full ring
+static volatile LONG log_writer_started = 0;
+static volatile LONG log_stop = 0;
+#ifdef _WIN32
+static HANDLE log_writer_thread = NULL;
+#else
+static pthread_t log_writer_thread;
+#endif
+
+static void mws_log_writer_loop(void)
+{
+    FILE *file = NULL;
+#ifdef _WIN32
+    fopen_s(&file, filePath2, "a");
+#else
+    file = fopen(filePath2, "a");
+#endif
+
+    for (;;)
+    {
+        int drained = 0;
+        while (log_head - log_tail > 0)
+        {
+            mws_log_slot *slot = &log_ring[log_tail & (MWS_LOG_RING_SLOTS - 1)];
+            if (!slot->ready)
+            {
+                break; // Claimed but not yet formatted; retry next pass
+            }
+            if (file != NULL)
+            {
+                fputs(slot->text, file);
+            }
+            slot->ready = 0;
+            InterlockedIncrement(&log_tail);
+            drained = 1;
+        }
+
+        LONG drops = InterlockedExchange(&log_dropped, 0);
+        if (drops > 0 && file != NULL)
+        {
+            fprintf(file, "MWS: logger dropped %ld messages (ring full)\n", (long)drops);
+        }
+        if (drained && file != NULL)
+        {
+            fflush(file);
+        }
+        if (log_stop && log_head - log_tail == 0)
+        {
+            break;
+        }
+        Sleep(drained ? 1 : 10);
+    }
+
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+}
+
+#ifdef _WIN32
+static unsigned __stdcall mws_log_writer(void *arg)
+{
+    (void)arg;
+    mws_log_writer_loop();
+    return 0;
+}
+#else
+static void *mws_log_writer(void *arg)
+{
+    (void)arg;
+    mws_log_writer_loop();
+    return NULL;
+}
+#endif
+
+static void mws_log_start_writer(void)
+{
+    if (log_writer_started != 0)
+    {
+        return;
+    }
+    if (InterlockedCompareExchange(&log_writer_started, 1, 0) != 0)
+    {
+        return; // Another thread won the race
+    }
+#ifdef _WIN32
+    log_writer_thread = (HANDLE)_beginthreadex(NULL, 0, mws_log_writer, NULL, 0, NULL);
+    if (log_writer_thread == NULL)
+    {
+        InterlockedExchange(&log_writer_started, 0);
+    }
+#else
+    if (pthread_create(&log_writer_thread, NULL, mws_log_writer, NULL) != 0)
+    {
+        InterlockedExchange(&log_writer_started, 0);
+    }
+#endif
+}
+
+void mws_log_write(int level, const char *format, ...)
+{
+    (void)level; // Runtime filtering is compile-time via the macros
+    mws_log_start_writer();
+
+    // Claim a slot, refusing to advance past a full ring: dropping under
+    // pressure is preferable to stalling the data path.
+    LONG seq;
+    for (;;)
+    {
+        seq = log_head;
+        if (seq - log_tail >= MWS_LOG_RING_SLOTS)
+        {
+            InterlockedIncrement(&log_dropped);
+            return;
+        }
+        if (InterlockedCompareExchange(&log_head, seq + 1, seq) == seq)
+        {
+            break;
+        }
+    }
+
+    mws_log_slot *slot = &log_ring[seq & (MWS_LOG_RING_SLOTS - 1)];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->text, sizeof(slot->text), format, args);
+    va_end(args);
+    InterlockedExchange(&slot->ready, 1); // Publish with a full barrier
+}
+
+void mws_log_shutdown(void)
+{
+    if (log_writer_started == 0)
+    {
+        return;
+    }
+    InterlockedExchange(&log_stop, 1);
+#ifdef _WIN32
+    if (log_writer_thread != NULL)
+    {
+        WaitForSingleObject(log_writer_thread, 1000);
+        CloseHandle(log_writer_thread);
+        log_writer_thread = NULL;
+    }
+#else
+    pthread_join(log_writer_thread, NULL);
+#endif
+    InterlockedExchange(&log_stop, 0);
+    InterlockedExchange(&log_writer_started, 0);
+}
+
+// ---- Legacy unleveled entry points ------------------------------------------
+// Existing call sites pass pre-formatted strings; they feed the ring at INFO
+// level. New code should prefer the MWS_LOG_* macros so disabled levels are
+// stripped at compile time.
 
 void logToFile2(const char *str)
 {
-    UNREFERENCED_PARAMETER(str);
-    // FILE *file;
-    // errno_t err;
-    // const char *mode = "a"; // Specify the file mode
-
-    // // Open the file using fopen_s
-    // err = fopen_s(&file, filePath2, mode);
-
-    // // Check if the file was opened successfully
-    // if (err == 0 && file != NULL)
-    // {
-    //     // Write the string to the file
-    //     fprintf(file, "%s", str);
-    //     // Close the file
-    //     fclose(file);
-    // }
+    mws_log_write(MWS_LOG_LEVEL_INFO, "%s", str);
 }
 
 void logToFileI2(long some_int)
 {
-    UNREFERENCED_PARAMETER(some_int);
-    // FILE *file;
-    // errno_t err;
-    // const char *mode = "a"; // Specify the file mode
-
-    // // Open the file using fopen_s
-    // err = fopen_s(&file, filePath2, mode);
-
-    // // Check if the file was opened successfully
-    // if (err == 0 && file != NULL)
-    // {
-    //     // Write the unsigned long integer to the file
-    //     fprintf(file, "%ld\n", some_int);
-    //     // Close the file
-    //     fclose(file);
-    // }
+    mws_log_write(MWS_LOG_LEVEL_INFO, "%ld\n", some_int);
 }
 
 void printHexBytesString2(const char *input, size_t size)
@@ -104,4 +257,4 @@ void print_state2(int state)
     default:
         break;
     }
-}
\ No newline at end of file
+}
@@ -7,9 +7,57 @@
 #endif
 #include <windows.h>
 // Any other Windows headers
+#else
+// POSIX backend: minimal mappings for the Win32 threading and atomics
+// vocabulary used by the logger and mws_lib.c.
+#include <unistd.h>
+#include <pthread.h>
+typedef int LONG;
+#define InterlockedIncrement(target)                 __atomic_add_fetch((target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(target, value)           __atomic_exchange_n((target), (value), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(dest, exch, comp) __sync_val_compare_and_swap((dest), (comp), (exch))
+#define Sleep(ms) usleep((unsigned)(ms) * 1000)
 #endif
 
 #include <stdio.h>
+
+// ---- Leveled logging --------------------------------------------------------
+// Messages carry a severity; levels above MWS_LOG_COMPILE_LEVEL are stripped
+// at compile time, so their call sites cost nothing - not even the argument
+// formatting. Enabled levels format into a lock-free ring buffer drained to
+// the log file by a background thread, keeping file I/O off the data path.
+// Override the level on the compiler command line, e.g.
+// /DMWS_LOG_COMPILE_LEVEL=3 for a debug-verbosity build.
+#define MWS_LOG_LEVEL_NONE 0
+#define MWS_LOG_LEVEL_ERROR 1
+#define MWS_LOG_LEVEL_INFO 2
+#define MWS_LOG_LEVEL_DEBUG 3
+
+#ifndef MWS_LOG_COMPILE_LEVEL
+#define MWS_LOG_COMPILE_LEVEL MWS_LOG_LEVEL_INFO
+#endif
+
+void mws_log_write(int level, const char *format, ...);
+void mws_log_shutdown(void);
+
+#if MWS_LOG_COMPILE_LEVEL >= MWS_LOG_LEVEL_ERROR
+#define MWS_LOG_ERROR(...) mws_log_write(MWS_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define MWS_LOG_ERROR(...) ((void)0)
+#endif
+
+#if MWS_LOG_COMPILE_LEVEL >= MWS_LOG_LEVEL_INFO
+#define MWS_LOG_INFO(...) mws_log_write(MWS_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define MWS_LOG_INFO(...) ((void)0)
+#endif
+
+#if MWS_LOG_COMPILE_LEVEL >= MWS_LOG_LEVEL_DEBUG
+#define MWS_LOG_DEBUG(...) mws_log_write(MWS_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define MWS_LOG_DEBUG(...) ((void)0)
+#endif
+
 void logToFile2(const char *);
 void logToFileI2(long);
 void print_state2(int state);
@@ -0,0 +1,275 @@
+/*
+ * bench.c
+ *
+ * Echo load generator for the mws_lib library, built to measure the effect of
+ * performance changes against the server-*.py echo servers. Unlike the sample
+ * clients (test-mws, test-nb) it drives sustained traffic: a configurable
+ * number of connections each send fixed-size messages at a fixed rate for a
+ * fixed duration, and every echoed message carries its send timestamp so
+ * round-trip latency can be measured per message.
+ *
+ * Usage:
+ *   bench.exe [uri] [-s size] [-r rate] [-c connections] [-d duration]
+ *
+ *     uri            WebSocket URI              (default ws://localhost:8765/)
+ *     -s size        Payload bytes per message  (default 125, minimum 8)
+ *     -r rate        Messages/second/connection (default 100)
+ *     -c connections Concurrent connections     (default 1, max 512)
+ *     -d duration    Test duration in seconds   (default 10)
+ *
+ * Reported at the end: throughput (messages/s and MB/s), p50/p99/p999
+ * round-trip latency from a histogram of every echo, and syscalls per
+ * message taken from the library's own counters (ws_get_process_stats).
+ *
+ * This file is intended to be built using Visual Studio on Windows.
+ */
+
+// IMPORTANT: Define WIN32_LEAN_AND_MEAN before any Windows headers
+#define WIN32_LEAN_AND_MEAN
+
+// Include Windows headers first
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+// Then include standard C headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Finally include the library header
+#include "../mws_lib.h"
+
+#define BENCH_MAX_CONNS 512
+
+// Latency histogram: 10 microseconds per bucket covers ~80 ms before the
+// overflow bucket; fine enough for p999 on a LAN echo.
+#define HIST_BUCKETS 8192
+#define HIST_BUCKET_US 10.0
+
+static uint64_t hist[HIST_BUCKETS + 1]; // [HIST_BUCKETS] = overflow
+static uint64_t hist_samples = 0;
+static double hist_min_ms = 1e9;
+static double hist_max_ms = 0.0;
+
+static double qpc_period_ms; // Milliseconds per performance-counter tick
+
+static double now_ms(void)
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart * qpc_period_ms;
+}
+
+static void hist_record(double rtt_ms)
+{
+    size_t bucket = (size_t)(rtt_ms * 1000.0 / HIST_BUCKET_US);
+    if (bucket > HIST_BUCKETS) {
+        bucket = HIST_BUCKETS;
+    }
+    hist[bucket]++;
+    hist_samples++;
+    if (rtt_ms < hist_min_ms) hist_min_ms = rtt_ms;
+    if (rtt_ms > hist_max_ms) hist_max_ms = rtt_ms;
+}
+
+// Latency at the given percentile (0..100), read from the histogram.
+static double hist_percentile(double percentile)
+{
+    if (hist_samples == 0) {
+        return 0.0;
+    }
+    uint64_t target = (uint64_t)(hist_samples * percentile / 100.0);
+    uint64_t seen = 0;
+    for (size_t i = 0; i <= HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > target) {
+            return (double)i * HIST_BUCKET_US / 1000.0;
+        }
+    }
+    return hist_max_ms;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* uri = "ws://localhost:8765/";
+    size_t message_size = 125;
+    int rate = 100;
+    int connections = 1;
+    int duration = 10;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            message_size = (size_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            duration = atoi(argv[++i]);
+        } else if (argv[i][0] != '-') {
+            uri = argv[i];
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (message_size < 8) {
+        message_size = 8; // Room for the embedded send timestamp
+    }
+    if (connections < 1) connections = 1;
+    if (connections > BENCH_MAX_CONNS) connections = BENCH_MAX_CONNS;
+    if (rate < 1) rate = 1;
+    if (duration < 1) duration = 1;
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    qpc_period_ms = 1000.0 / (double)frequency.QuadPart;
+
+    printf("bench: %s  size=%zu  rate=%d msg/s/conn  conns=%d  duration=%ds\n",
+           uri, message_size, rate, connections, duration);
+
+    if (ws_init() != 0) {
+        fprintf(stderr, "ws_init failed\n");
+        return 1;
+    }
+
+    // Every connection reuses the same arena-sized context; the send buffer
+    // is shared because the payload is rewritten before each send.
+    char* payload = (char*)malloc(message_size);
+    char* recv_buffer = (char*)malloc(message_size + 16);
+    if (!payload || !recv_buffer) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memset(payload, 'x', message_size);
+
+    static ws_ctx* ctx[BENCH_MAX_CONNS];
+    static double next_send_ms[BENCH_MAX_CONNS];
+    // ws_recv is resumable and may hand one echo back in several chunks, so
+    // each connection tracks how much of the current message has arrived and
+    // holds its first 8 bytes (the send stamp) until the message completes.
+    static size_t echo_bytes[BENCH_MAX_CONNS];
+    static char echo_stamp[BENCH_MAX_CONNS][sizeof(double)];
+
+    double interval_ms = 1000.0 / rate;
+    double start_ms = now_ms();
+
+    for (int i = 0; i < connections; i++) {
+        ctx[i] = ws_create_ctx_ex(message_size);
+        if (!ctx[i] || ws_connect(ctx[i], uri) != 0) {
+            fprintf(stderr, "Connection %d failed\n", i);
+            return 1;
+        }
+        ws_set_ping_pong(ctx[i], 0); // No keepalives during the measurement
+        // Stagger the first sends so connections do not burst in lockstep.
+        next_send_ms[i] = start_ms + interval_ms * i / connections;
+    }
+
+    uint64_t sent_messages = 0;
+    uint64_t received_messages = 0;
+    uint64_t received_bytes = 0;
+    double end_ms = now_ms() + duration * 1000.0;
+
+    while (now_ms() < end_ms) {
+        bool idle = true;
+        double tick_ms = now_ms();
+
+        for (int i = 0; i < connections; i++) {
+            if (ws_get_state(ctx[i]) != WS_STATE_OPEN) {
+                fprintf(stderr, "Connection %d dropped mid-test\n", i);
+                return 1;
+            }
+
+            // Send when this connection's next slot has arrived, stamping the
+            // payload with the current counter so the echo carries it back.
+            if (tick_ms >= next_send_ms[i]) {
+                double stamp = now_ms();
+                memcpy(payload, &stamp, sizeof(stamp));
+                if (ws_send(ctx[i], payload, message_size, WS_OPCODE_BINARY) != 0) {
+                    fprintf(stderr, "Send failed on connection %d\n", i);
+                    return 1;
+                }
+                sent_messages++;
+                next_send_ms[i] += interval_ms;
+                idle = false;
+            }
+
+            // Drain whatever echoes have arrived (never blocks).
+            int received = ws_recv(ctx[i], recv_buffer, message_size + 16);
+            if (received < 0) {
+                fprintf(stderr, "Receive failed on connection %d\n", i);
+                return 1;
+            }
+            if (received > 0) {
+                received_bytes += (uint64_t)received;
+                idle = false;
+                // Fold the chunk into the in-progress message (a chunk can
+                // also span a message boundary); only a completed message
+                // yields a latency sample, stamped from its first 8 bytes.
+                size_t offset = 0;
+                while (offset < (size_t)received) {
+                    size_t take = message_size - echo_bytes[i];
+                    if (take > (size_t)received - offset) {
+                        take = (size_t)received - offset;
+                    }
+                    if (echo_bytes[i] < sizeof(echo_stamp[i])) {
+                        size_t head = sizeof(echo_stamp[i]) - echo_bytes[i];
+                        if (head > take) head = take;
+                        memcpy(echo_stamp[i] + echo_bytes[i], recv_buffer + offset, head);
+                    }
+                    echo_bytes[i] += take;
+                    offset += take;
+                    if (echo_bytes[i] == message_size) {
+                        double sent_stamp;
+                        memcpy(&sent_stamp, echo_stamp[i], sizeof(sent_stamp));
+                        hist_record(now_ms() - sent_stamp);
+                        received_messages++;
+                        echo_bytes[i] = 0;
+                    }
+                }
+            }
+        }
+
+        if (idle) {
+            Sleep(0); // Yield between slots instead of spinning flat out
+        }
+    }
+
+    double elapsed_s = (now_ms() - start_ms) / 1000.0;
+
+    ws_stats totals;
+    ws_get_process_stats(&totals);
+
+    for (int i = 0; i < connections; i++) {
+        ws_close(ctx[i]);
+        ws_destroy_ctx(ctx[i]);
+    }
+    ws_cleanup();
+
+    printf("\n--- results (%.1fs elapsed) ---\n", elapsed_s);
+    printf("sent:       %llu messages\n", (unsigned long long)sent_messages);
+    printf("received:   %llu messages (%.2f MB)\n",
+           (unsigned long long)received_messages, received_bytes / (1024.0 * 1024.0));
+    printf("throughput: %.0f msg/s, %.2f MB/s\n",
+           received_messages / elapsed_s, received_bytes / (1024.0 * 1024.0) / elapsed_s);
+    if (hist_samples > 0) {
+        printf("latency:    min %.3f ms  p50 %.3f ms  p99 %.3f ms  p999 %.3f ms  max %.3f ms\n",
+               hist_min_ms, hist_percentile(50.0), hist_percentile(99.0),
+               hist_percentile(99.9), hist_max_ms);
+    }
+    if (received_messages > 0) {
+        printf("syscalls:   %.2f send + %.2f recv per message\n",
+               (double)totals.send_syscalls / received_messages,
+               (double)totals.recv_syscalls / received_messages);
+        printf("partials:   %llu partial sends, %llu would-block polls\n",
+               (unsigned long long)totals.partial_sends,
+               (unsigned long long)totals.would_block_peeks);
+    }
+
+    free(payload);
+    free(recv_buffer);
+    return 0;
+}
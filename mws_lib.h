@@ -13,6 +13,56 @@
 #endif
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#else
+// POSIX backend. The implementation speaks the Winsock vocabulary
+// throughout; mapping that vocabulary onto BSD sockets once here keeps the
+// translation unit free of per-call-site #ifdefs.
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+typedef int SOCKET;
+typedef uint32_t DWORD;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR   (-1)
+#define closesocket(s)            close(s)
+#define ioctlsocket(s, cmd, argp) ioctl((s), (cmd), (argp))
+#define WSAGetLastError()         (errno)
+#define WSASetLastError(e)        ((void)(errno = (e)))
+#define WSAEWOULDBLOCK            EWOULDBLOCK
+#define WSAEINPROGRESS            EINPROGRESS
+#define SD_SEND                   SHUT_WR
+
+#ifndef POLLRDNORM
+#define POLLRDNORM POLLIN
+#endif
+typedef struct pollfd WSAPOLLFD;
+#define WSAPoll(fds, count, timeout) poll((fds), (count), (timeout))
+
+// MSVC secure-CRT string helpers and the min() macro from windef.h, used
+// throughout the implementation. Every call site bounds its output, so the
+// plain libc forms are equivalent here.
+#define strcpy_s(dest, size, src)         ((void)snprintf((dest), (size), "%s", (src)))
+#define strncpy_s(dest, size, src, count) ((void)snprintf((dest), (size), "%.*s", (int)(count), (src)))
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+// Scatter-gather buffer in Winsock layout; ws_send_buffers translates it to
+// struct iovec at the writev call.
+typedef struct {
+    unsigned long len;
+    char* buf;
+} WSABUF;
 #endif
 
 #ifdef __cplusplus
@@ -36,6 +86,56 @@ extern "C" {
         WS_STATE_UNKNOWN        // State is unknown or not determined
     } ws_state;
 
+    // Incremental frame-decoder states (see ws_recv)
+    typedef enum {
+        WS_PARSE_HEADER,        // Waiting for a complete frame header
+        WS_PARSE_PAYLOAD        // Delivering payload bytes of the staged frame
+    } ws_parse_state;
+
+    // Asynchronous connect states (see ws_connect_start / ws_connect_continue)
+    typedef enum {
+        WS_CONNECT_IDLE,           // No async connect in progress
+        WS_CONNECT_CONNECTING,     // TCP connect pending on the current address
+        WS_CONNECT_SEND_HANDSHAKE, // Upgrade request being written
+        WS_CONNECT_RECV_RESPONSE,  // Waiting for the 101 response
+        WS_CONNECT_DONE,           // Connection established
+        WS_CONNECT_FAILED          // Connect failed; context is closed
+    } ws_connect_state;
+
+    // Automatic reconnect parameters (see ws_set_reconnect_policy)
+    typedef struct {
+        int initial_delay_ms; // Delay before the first retry (default 500)
+        int max_delay_ms;     // Backoff ceiling (default 30000)
+        int jitter_percent;   // Random +/- percent per delay (0 = none, negative = default 20)
+        int max_attempts;     // Give up after this many failures (0 = never)
+    } ws_reconnect_policy;
+
+    // Transport tuning applied to the underlying TCP socket. Zero-initialize
+    // and set only the fields to change; zero means "leave the kernel
+    // default". Set the options on the context before ws_connect (they are
+    // applied at socket creation) or afterwards to retune a live connection.
+    typedef struct {
+        int tcp_nodelay;     // Nonzero disables Nagle (TCP_NODELAY)
+        int send_buffer;     // SO_SNDBUF size in bytes
+        int recv_buffer;     // SO_RCVBUF size in bytes
+        int keepalive;       // Nonzero enables TCP keepalive (SO_KEEPALIVE)
+    } ws_transport_options;
+
+    // Hot-path counters, maintained with plain increments on the owning
+    // thread and snapshotted with ws_get_stats / ws_get_process_stats.
+    typedef struct {
+        uint64_t frames_sent[16];     // Outbound frames, indexed by opcode
+        uint64_t frames_received[16]; // Inbound frames, indexed by opcode
+        uint64_t bytes_sent;          // Payload bytes handed to the socket
+        uint64_t bytes_received;      // Payload bytes delivered to callers
+        uint64_t send_syscalls;       // send()/WSASend() calls issued
+        uint64_t recv_syscalls;       // recv()/WSARecv() calls issued
+        uint64_t would_block_peeks;   // Control-frame peeks answered WSAEWOULDBLOCK
+        uint64_t partial_sends;       // Sends that accepted fewer bytes than offered
+        uint64_t messages_assembled;  // Fragmented messages completed on receive
+        uint64_t reconnects;          // Successful handshakes after this context's first
+    } ws_stats;
+
     // WebSocket context structure
     struct ws_ctx {
         SOCKET socket;           // Socket handle for the WebSocket connection
@@ -43,8 +143,92 @@ extern "C" {
         char* recv_buffer;       // Buffer to store received data
         size_t recv_buffer_size; // Total size of the receive buffer
         size_t recv_buffer_len;  // Current length of data in the receive buffer
+        size_t recv_buffer_pos;  // Offset of the first unconsumed byte in recv_buffer
         int ping_interval;       // Interval in seconds between ping frames (0 = disabled)
         time_t last_ping_time;   // Time when the last ping was sent
+        bool nonblocking;        // Socket is kept non-blocking for the connection's lifetime
+        uint64_t rng_state;      // Per-context PRNG state for masks and keys (see ws_rand32)
+        ws_transport_options transport; // Socket tuning applied at connect time
+
+        // Ping RTT tracking and adaptive keepalive (see ws_get_rtt)
+        int64_t ping_sent_qpc;   // QPC tick of the PING awaiting its PONG (0 = none)
+        double rtt_last_ms;      // Most recent round-trip time
+        double rtt_min_ms;       // Lowest round-trip time on this connection
+        double rtt_ewma_ms;      // Smoothed round-trip time (alpha = 1/8)
+        bool rtt_valid;          // At least one PING/PONG pair has been timed
+        bool adaptive_ping;      // Widen the ping interval while the link is healthy
+        int ping_interval_base;  // Configured interval adaptive mode scales from
+
+        // Instrumentation (see ws_get_stats)
+        ws_stats stats;            // Counters for this connection
+        struct ws_ctx* stats_next; // Live-context registry link (internal)
+        bool has_connected;        // A handshake has completed on this context
+        void* pool;                // Owning context pool, when acquired from one (internal)
+
+        // TLS transport (wss:// URIs). The state pointer is opaque SChannel
+        // plumbing owned by the library; NULL on plaintext connections.
+        bool use_tls;            // Connection negotiated TLS below the WebSocket layer
+        void* tls;               // Internal SChannel state (see mws_lib.c)
+
+        // Automatic reconnect (see ws_set_reconnect_policy). The URI of the
+        // most recent connect is kept so ws_service can redial it.
+        ws_reconnect_policy reconnect; // Backoff parameters
+        bool reconnect_enabled;        // A policy is attached and active
+        char reconnect_uri[512];       // Endpoint to redial
+        int reconnect_attempts;        // Failed attempts since the last OPEN
+        int reconnect_delay_ms;        // Current backoff delay
+        DWORD reconnect_due_tick;      // GetTickCount() time of the next attempt (0 = due now)
+
+        // Frame arena: a grow-once scratch buffer reused for all internal
+        // frame assembly, so steady-state sends never touch the CRT heap.
+        char* frame_arena;       // Arena memory (NULL until first use)
+        size_t frame_arena_size; // Current arena capacity in bytes
+
+        // Outbound queue: encoded frame bytes that could not be written
+        // without blocking are staged here and flushed opportunistically
+        // (see ws_send_queued / ws_flush).
+        char* send_queue;        // Staged frame bytes (NULL until first use)
+        size_t send_queue_size;  // Queue capacity in bytes
+        size_t send_queue_len;   // Bytes currently staged
+        size_t send_queue_pos;   // Offset of the first unsent staged byte
+
+        // Asynchronous connect state, used only between ws_connect_start and
+        // the ws_connect_continue call that finishes (or fails) the connect.
+        ws_connect_state connect_state;  // Where the async connect machine is
+        struct addrinfo* connect_addrs;  // Resolved address list (owned)
+        struct addrinfo* connect_current;// Candidate address being attempted
+        char connect_request[1024];      // Prebuilt upgrade request
+        int connect_request_len;         // Total upgrade request length
+        int connect_request_sent;        // Request bytes already written
+        char connect_response[2048];     // Accumulated handshake response
+        int connect_response_len;        // Response bytes received so far
+
+        // permessage-deflate (RFC 7692) state. The stream pointers are
+        // z_stream* kept as void* so this header never depends on zlib;
+        // they are created lazily and live for the whole connection, so
+        // compression costs no per-message setup. Only meaningful when the
+        // library is built with MWS_ENABLE_PERMESSAGE_DEFLATE.
+        bool deflate_offered;            // Offer the extension in the handshake
+        bool deflate_negotiated;         // Server accepted permessage-deflate
+        bool deflate_reset_tx;           // client_no_context_takeover: reset deflate per message
+        bool deflate_tx_disabled;        // Granted window below 9 bits: inflate inbound, send plain
+        int deflate_tx_window_bits;      // client_max_window_bits granted by the server
+        void* deflate_stream;            // Outbound z_stream (NULL until first use)
+        void* inflate_stream;            // Inbound z_stream (NULL until first use)
+        char* inflate_buffer;            // Decompressed-message staging (ws_recv_frame)
+        size_t inflate_buffer_size;      // Staging buffer capacity
+        bool rx_message_compressed;      // Current inbound message carries RSV1
+        uint64_t inflate_msg_offset;     // Decompressed bytes delivered so far (streaming)
+
+        // Staged frame state so the decoder can resume a frame that arrived
+        // split across TCP segments without ever blocking mid-frame.
+        ws_parse_state parse_state;      // Current decoder state
+        bool frame_fin;                  // FIN bit of the staged frame
+        int frame_opcode;                // Opcode of the staged frame
+        bool frame_masked;               // Whether the staged frame is masked
+        uint32_t frame_mask_key;         // Mask key of the staged frame
+        uint64_t frame_payload_length;   // Total payload length of the staged frame
+        uint64_t frame_payload_consumed; // Payload bytes already delivered
     };
     // WebSocket context
     typedef struct ws_ctx ws_ctx;
@@ -58,21 +242,165 @@ extern "C" {
     // Create a new WebSocket context
     ws_ctx* ws_create_ctx(void);
 
+    // Create a new WebSocket context with the frame arena pre-sized for the
+    // caller's typical message size (0 = allocate lazily on first send).
+    ws_ctx* ws_create_ctx_ex(size_t frame_arena_hint);
+
     // Connect to a WebSocket server
     int ws_connect(ws_ctx* ctx, const char* uri);
 
+    // Begin a non-blocking connect: parses the URI, resolves the host, builds
+    // the upgrade request and starts a TCP connect on the first candidate
+    // address without waiting for it. Drive the rest with ws_connect_continue.
+    // Returns 0 when the connect is under way, -1 on error.
+    int ws_connect_start(ws_ctx* ctx, const char* uri);
+
+    // Advance a pending async connect as far as the socket allows without
+    // blocking: walks the candidate addresses, writes the upgrade request and
+    // parses the 101 response. Returns 1 once the connection is OPEN, 0 while
+    // still in progress (call again on the next event-loop pass), -1 on
+    // failure (the context is closed and the machine reset).
+    int ws_connect_continue(ws_ctx* ctx);
+
+    // Attach an automatic reconnect policy. Once set, ws_service on a closed
+    // connection redials the URI of the most recent connect using the async
+    // machine above — exponential backoff doubling from initial_delay_ms up
+    // to max_delay_ms, with +/- jitter_percent so a fleet of contexts does
+    // not retry in lockstep. Probing a down server then costs one pending
+    // non-blocking connect per backoff window instead of a polling thread.
+    // Pass NULL to detach the policy. Returns 0 on success, -1 on failure.
+    int ws_set_reconnect_policy(ws_ctx* ctx, const ws_reconnect_policy* policy);
+
     // Send data over the WebSocket
     int ws_send(ws_ctx* ctx, const char* data, size_t length, int opcode);
 
+    // Flags for ws_send_ex
+#define WS_SEND_DEFAULT        0x0  // Copy-and-mask into an internal frame buffer (same as ws_send)
+#define WS_SEND_MASK_IN_PLACE  0x1  // Mask the caller's buffer in place; buffer contents are clobbered
+
+    // Send data over the WebSocket with flags. With WS_SEND_MASK_IN_PLACE the
+    // header and payload are sent with one scatter-gather syscall and no
+    // allocation or payload copy; 'data' is left masked on return.
+    int ws_send_ex(ws_ctx* ctx, char* data, size_t length, int opcode, int flags);
+
+    // One outbound message for ws_send_batch
+    typedef struct {
+        const char* data;    // Payload bytes (may be NULL when length is 0)
+        size_t length;       // Payload length in bytes
+        int opcode;          // WS_OPCODE_* value for this frame
+    } ws_msg;
+
+    // Send a burst of messages as individual frames packed into a single
+    // write, so the whole batch costs one syscall instead of one per frame.
+    int ws_send_batch(ws_ctx* ctx, const ws_msg* messages, size_t count);
+
+    // Broadcast one payload to many connections. The frame — header, mask
+    // key and masked payload — is built exactly once and the identical bytes
+    // are written to every open context, so the masking and copying cost is
+    // O(bytes) instead of O(connections x bytes). Contexts that negotiated
+    // permessage-deflate fall back to their per-connection send path.
+    // Returns the number of contexts the frame was sent to, -1 on invalid
+    // arguments.
+    int ws_send_multi(ws_ctx** ctxs, size_t count, const char* data, size_t length, int opcode);
+
+    // Stream 'length' bytes of an open file (GENERIC_READ handle on Windows,
+    // file descriptor on POSIX) from 'offset' as one fragmented binary
+    // message. The file is memory-mapped in windows and each window is
+    // masked straight from the mapping into the outgoing frame, so every
+    // payload byte is touched exactly once in user space — no
+    // read-into-buffer staging. Returns 0 on success, -1 on failure.
+#ifdef _WIN32
+    int ws_send_file(ws_ctx* ctx, HANDLE file, uint64_t offset, uint64_t length);
+#else
+    int ws_send_file(ws_ctx* ctx, int file, uint64_t offset, uint64_t length);
+#endif
+
+    // Queue-based send: writes as much of the frame as the socket accepts
+    // right now and stages the rest in the context's outbound queue, to be
+    // flushed opportunistically by ws_service / ws_flush. A send under
+    // backpressure therefore costs bounded memory instead of a blocked
+    // thread. Returns 0 when the frame was fully sent or staged, -1 on error.
+    int ws_send_queued(ws_ctx* ctx, const char* data, size_t length, int opcode);
+
+    // Write staged outbound bytes without blocking (called automatically
+    // from ws_service). Returns the number of bytes still queued after the
+    // attempt, or -1 on error.
+    int ws_flush(ws_ctx* ctx);
+
+    // Bytes currently staged in the outbound queue, so producers can
+    // throttle themselves when the connection is backed up.
+    size_t ws_send_queue_bytes(const ws_ctx* ctx);
+
     // Receive data from the WebSocket (non-blocking)
     int ws_recv(ws_ctx* ctx, char* buffer, size_t buffer_size);
 
+    // Streaming receive callback (see ws_recv_stream). 'chunk' points into
+    // the library's receive buffer and is valid only for the duration of the
+    // call. 'offset' is the chunk's byte position within the current frame's
+    // payload, and 'final' is true when the chunk completes the final
+    // fragment of a message.
+    typedef void (*ws_on_chunk_cb)(ws_ctx* ctx, const char* chunk, size_t length,
+                                   int opcode, uint64_t offset, bool final, void* user_data);
+
+    // Streaming receive: drains whatever has arrived through the incremental
+    // decoder and hands payload chunks to 'on_chunk' as they are unmasked in
+    // place, so an arbitrarily large message is processed with the same small
+    // receive buffer as a tiny one and nothing is ever discarded. Never
+    // blocks. Returns the number of payload bytes delivered, 0 when nothing
+    // was available, -1 on error or connection close.
+    int ws_recv_stream(ws_ctx* ctx, ws_on_chunk_cb on_chunk, void* user_data);
+
+    // A received frame viewed in place in the library's receive buffer
+    typedef struct {
+        int opcode;          // Frame opcode (TEXT/BINARY/CONTINUATION)
+        bool fin;            // FIN bit (true for the final fragment of a message)
+        char* payload;       // Payload bytes inside the library buffer (unmasked)
+        size_t length;       // Payload length in bytes
+    } ws_frame_view;
+
+    // Zero-copy receive: returns the next complete data frame as a view into
+    // the library's receive buffer (unmasked in place), with no copy into a
+    // caller buffer. The view is valid until the next receive call on this
+    // context. Do not interleave with ws_recv mid-message.
+    // Returns 1 when a frame view is available, 0 when no complete frame is
+    // ready right now, -1 on error or connection close.
+    int ws_recv_frame(ws_ctx* ctx, ws_frame_view* view);
+
     // Close the WebSocket connection
     int ws_close(ws_ctx* ctx);
 
     // Destroy the WebSocket context
     void ws_destroy_ctx(ws_ctx* ctx);
 
+    // Context pool: a fixed slab of cache-line-aligned ws_ctx slots for
+    // churn-heavy workloads (opaque; see ws_ctx_pool_* functions).
+    // Short-lived connections recycle slots instead of hitting the heap,
+    // and a recycled slot keeps its receive buffer, frame arena and send
+    // queue, so a fresh connection inherits warm, full-sized buffers. The
+    // slab is contiguous, so iterating it walks memory linearly.
+    typedef struct ws_ctx_pool ws_ctx_pool;
+
+    // Create a pool holding up to 'capacity' contexts (the slab is
+    // allocated up front and never moves, so context pointers stay stable)
+    ws_ctx_pool* ws_ctx_pool_create(size_t capacity);
+
+    // Take a context from the pool, initialized exactly like ws_create_ctx.
+    // Returns NULL when every slot is in use.
+    ws_ctx* ws_ctx_pool_acquire(ws_ctx_pool* pool);
+
+    // Return a context to the pool. Connection state is torn down; the
+    // slot's buffers are kept for the next acquire. ws_destroy_ctx on a
+    // pooled context forwards here, so either call is safe.
+    int ws_ctx_pool_release(ws_ctx_pool* pool, ws_ctx* ctx);
+
+    // Walk the pool's live contexts in slab order: pass NULL for the first,
+    // then the previous return value. Returns NULL past the last one. The
+    // per-tick service sweep over a pool therefore reads memory linearly.
+    ws_ctx* ws_ctx_pool_next(ws_ctx_pool* pool, ws_ctx* prev);
+
+    // Destroy the pool and every context in it, acquired or not
+    void ws_ctx_pool_destroy(ws_ctx_pool* pool);
+
     // Cleanup the WebSocket library
     void ws_cleanup(void);
 
@@ -87,9 +415,109 @@ extern "C" {
 
     int ws_set_ping_pong(ws_ctx* ctx, int interval);
 
+    // Rolling ping round-trip statistics (see ws_get_rtt)
+    typedef struct {
+        double last_ms;      // RTT of the most recent PING/PONG exchange
+        double min_ms;       // Lowest RTT observed on this connection
+        double ewma_ms;      // Exponentially weighted moving average (alpha = 1/8)
+    } ws_rtt_stats;
+
+    // Snapshot the ping RTT statistics, measured with the high-resolution
+    // performance counter. Returns 0 when at least one PING/PONG pair has
+    // been timed on this connection, -1 before the first sample.
+    int ws_get_rtt(ws_ctx* ctx, ws_rtt_stats* stats);
+
+    // Adaptive keepalive: each answered ping doubles the ping interval (up
+    // to 8x the interval set with ws_set_ping_pong) and an unanswered ping
+    // snaps it back, saving wakeups and bandwidth on healthy idle links.
+    int ws_set_adaptive_ping(ws_ctx* ctx, int enabled);
+
+    // Snapshot this context's hot-path counters. Returns 0 on success, -1 on
+    // invalid arguments.
+    int ws_get_stats(ws_ctx* ctx, ws_stats* stats);
+
+    // Snapshot the process-wide aggregate: every live context's counters plus
+    // the accumulated totals of already-destroyed ones. Returns 0 on success,
+    // -1 on invalid arguments.
+    int ws_get_process_stats(ws_stats* stats);
+
+    // Record transport tuning for this context and, when the socket already
+    // exists, apply it immediately. Options set before ws_connect /
+    // ws_connect_start are applied to every candidate socket as it is
+    // created, ahead of the TCP handshake.
+    int ws_set_transport_options(ws_ctx* ctx, const ws_transport_options* options);
+
+    // Offer permessage-deflate (RFC 7692) in the next handshake on this
+    // context (set before ws_connect / ws_connect_start). When the server
+    // accepts, data messages are compressed and decompressed transparently by
+    // the normal send/receive calls using per-context streams that persist
+    // across messages. Returns 0 on success; -1 when the library was built
+    // without MWS_ENABLE_PERMESSAGE_DEFLATE.
+    int ws_enable_permessage_deflate(ws_ctx* ctx, int enabled);
+
+    // Keep the socket permanently non-blocking (set before ws_connect; takes
+    // effect once the handshake completes). All internal reads and writes then
+    // handle WSAEWOULDBLOCK internally instead of flipping FIONBIO per call.
+    int ws_set_nonblocking(ws_ctx* ctx, int enabled);
+
 
     int ws_check_connection(ws_ctx* ctx);
 
+    // Connection group: services many contexts with one readiness syscall
+    // (WSAPoll on Windows, edge-triggered epoll on Linux) instead of
+    // per-context peeks (opaque; see ws_group_* functions)
+    typedef struct ws_group ws_group;
+
+    // Create an empty connection group
+    ws_group* ws_group_create(void);
+
+    // Register a context with the group (a context belongs to at most one group)
+    int ws_group_add(ws_group* group, ws_ctx* ctx);
+
+    // Unregister a context from the group
+    int ws_group_remove(ws_group* group, ws_ctx* ctx);
+
+    // Wait for readiness on every registered socket with a single syscall,
+    // run the usual control-frame and keepalive machinery for the sockets
+    // that are ready, and fill 'ready' (up to ready_capacity entries) with
+    // the contexts that have application data pending. Returns the number of
+    // entries written, 0 when nothing is ready within timeout_ms, -1 on
+    // error.
+    int ws_group_service(ws_group* group, int timeout_ms, ws_ctx** ready, size_t ready_capacity);
+
+    // Destroy the group (the contexts themselves are left untouched)
+    void ws_group_destroy(ws_group* group);
+
+    // Asynchronous engine: overlapped WSARecv/WSASend wired into an I/O
+    // completion port, drained by a small worker-thread pool (opaque; see
+    // ws_engine_* functions). Frame encode/decode is shared with the
+    // synchronous ws_send/ws_recv paths. Windows-only; on POSIX the
+    // ws_engine_* calls fail and ws_group_service covers the many-connection
+    // case.
+    typedef struct ws_engine ws_engine;
+
+    // Completion callbacks, invoked on engine worker threads. The payload
+    // pointer passed to on_message points into the library's receive buffer
+    // and is valid only for the duration of the callback.
+    typedef void (*ws_on_message_cb)(ws_ctx* ctx, const char* data, size_t length, int opcode, bool fin, void* user_data);
+    typedef void (*ws_on_sent_cb)(ws_ctx* ctx, size_t length, void* user_data);
+    typedef void (*ws_on_closed_cb)(ws_ctx* ctx, void* user_data);
+
+    // Create an engine with the given number of worker threads (<= 0 picks 2)
+    ws_engine* ws_engine_create(int worker_threads);
+
+    // Attach an open connection to the engine and start receiving. After
+    // attaching, use ws_engine_send instead of ws_send/ws_recv on this context.
+    int ws_engine_attach(ws_engine* engine, ws_ctx* ctx,
+                         ws_on_message_cb on_message, ws_on_sent_cb on_sent,
+                         ws_on_closed_cb on_closed, void* user_data);
+
+    // Queue a frame for overlapped transmission; on_sent fires on completion
+    int ws_engine_send(ws_engine* engine, ws_ctx* ctx, const char* data, size_t length, int opcode);
+
+    // Stop the workers and free the engine (contexts are left untouched)
+    void ws_engine_destroy(ws_engine* engine);
+
 #ifdef __cplusplus
 }
 #endif